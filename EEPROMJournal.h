@@ -0,0 +1,161 @@
+/*
+ * A small append-only journal for persisting a struct in EEPROM without wearing out a single cell.
+ *
+ * Each put() writes a new record (sequence number, payload length, payload, CRC-8) to the next
+ * fixed-size slot in a ring that spans the given EEPROM range, using EEPROM.update() so unchanged
+ * bytes aren't rewritten. begin() scans every slot once and keeps the newest record with a valid CRC.
+ * A slot is invalidated before its payload is rewritten and its sequence number is written last, so
+ * a write interrupted by a reset or brown-out just leaves the previous record in place.
+ *
+ * Slots don't depend on sizeof(T), so fields can be appended to T later: begin() reports a record
+ * written with a different size as JOURNAL_RESIZED and loads the bytes both layouts share.
+
+ * More info here: https://shumphries.ca/blog/2023/01/03/oregon-scientific-attiny85
+ *
+ * LICENCE
+ *
+ * Copyright © 2023 Stephen Humphries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef EEPROMJOURNAL_H
+#define EEPROMJOURNAL_H
+
+#include <EEPROM.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#define JOURNAL_ERASED_SEQ 0xffff // Erased EEPROM reads as 0xff, so this sequence number is never written
+#define JOURNAL_ERASED_LEN 0xff // Never a valid payload length, so a slot with this length was never written
+
+// begin() results
+#define JOURNAL_BLANK 0 // Nothing has ever been written to the journal's EEPROM range
+#define JOURNAL_INVALID 1 // Slots have been written, but none holds a valid record
+#define JOURNAL_OK 2
+#define JOURNAL_RESIZED 3 // The newest record has a different size from T; only the shared bytes were loaded
+
+template <typename T, uint8_t SLOT_LEN = 16>
+class EEPROMJournal {
+  static_assert(sizeof(T) <= SLOT_LEN - 4, "T doesn't fit in a journal slot; increase SLOT_LEN");
+
+  public:
+  const uint16_t start;
+  const uint16_t slots;
+
+  EEPROMJournal(uint16_t start = 0, uint16_t length = E2END + 1): start(start), slots(length / SLOT_LEN) {}
+
+  uint8_t begin(T &value) { // Bytes of value that the newest record doesn't cover are left as passed in
+    bool written = false;
+    found = false;
+
+    for (uint16_t i = 0; i < slots; ++i) {
+      uint16_t seq;
+      uint8_t len;
+      if (EEPROM.read(start + i * SLOT_LEN + 2) != JOURNAL_ERASED_LEN) written = true;
+      if (!readRecord(i, seq, len)) continue;
+
+      if (!found || (int16_t)(seq - lastSeq) > 0) { // Sequence numbers wrap, so compare them by difference
+        found = true;
+        lastSlot = i;
+        lastSeq = seq;
+        lastLen = len;
+      }
+    }
+
+    if (!found) return written ? JOURNAL_INVALID : JOURNAL_BLANK;
+
+    uint8_t *payload = (uint8_t *)&value;
+    for (uint8_t i = 0; i < lastLen && i < sizeof(T); ++i) {
+      payload[i] = EEPROM.read(start + lastSlot * SLOT_LEN + 3 + i);
+    }
+    current = value;
+
+    return lastLen == sizeof(T) ? JOURNAL_OK : JOURNAL_RESIZED;
+  }
+
+  void put(const T &value) {
+    if (found && lastLen == sizeof(T) && memcmp(&value, &current, sizeof(T)) == 0) return; // Nothing changed; don't spend a write
+
+    const uint16_t slot = found ? (lastSlot + 1) % slots : 0;
+    uint16_t seq = found ? lastSeq + 1 : 0;
+    if (seq == JOURNAL_ERASED_SEQ) ++seq;
+
+    const uint8_t *payload = (const uint8_t *)&value;
+    const uint16_t addr = start + slot * SLOT_LEN;
+    uint8_t crc = 0;
+
+    crc = _crc8_ccitt_update(crc, seq & 0xff);
+    crc = _crc8_ccitt_update(crc, seq >> 8);
+    crc = _crc8_ccitt_update(crc, sizeof(T));
+    for (uint8_t i = 0; i < sizeof(T); ++i) {
+      crc = _crc8_ccitt_update(crc, payload[i]);
+    }
+
+    // The CRC catches any single changed byte, so every state a power cut can leave behind is invalid:
+    // changing the first byte of the old record, a slot marked erased, or the final record minus one byte
+    EEPROM.update(addr + 0, JOURNAL_ERASED_SEQ & 0xff); // Only erases/writes a cell if the value differs
+    EEPROM.update(addr + 1, JOURNAL_ERASED_SEQ >> 8);
+    EEPROM.update(addr + 2, sizeof(T));
+    for (uint8_t i = 0; i < sizeof(T); ++i) {
+      EEPROM.update(addr + 3 + i, payload[i]);
+    }
+    EEPROM.update(addr + SLOT_LEN - 1, crc);
+    EEPROM.update(addr + 0, seq & 0xff); // Sequence number last; it's what makes the record valid
+    EEPROM.update(addr + 1, seq >> 8);
+
+    found = true;
+    lastSlot = slot;
+    lastSeq = seq;
+    lastLen = sizeof(T);
+    current = value;
+  }
+
+  private:
+  // Slot layout: sequence number (2), payload length (1), payload (up to SLOT_LEN - 4), CRC (last byte)
+
+  bool found = false;
+  uint16_t lastSlot;
+  uint16_t lastSeq;
+  uint8_t lastLen;
+  T current;
+
+  bool readRecord(uint16_t slot, uint16_t &seq, uint8_t &len) {
+    const uint16_t addr = start + slot * SLOT_LEN;
+    uint8_t crc = 0;
+
+    const uint8_t seqLow = EEPROM.read(addr + 0);
+    const uint8_t seqHigh = EEPROM.read(addr + 1);
+    len = EEPROM.read(addr + 2);
+    crc = _crc8_ccitt_update(crc, seqLow);
+    crc = _crc8_ccitt_update(crc, seqHigh);
+    crc = _crc8_ccitt_update(crc, len);
+    seq = (seqHigh << 8) | seqLow;
+
+    if (seq == JOURNAL_ERASED_SEQ || len > SLOT_LEN - 4) return false;
+
+    for (uint8_t i = 0; i < len; ++i) {
+      crc = _crc8_ccitt_update(crc, EEPROM.read(addr + 3 + i));
+    }
+
+    return crc == EEPROM.read(addr + SLOT_LEN - 1);
+  }
+};
+
+#endif /* EEPROMJOURNAL_H */
@@ -4,9 +4,31 @@
  * Requires a 433.92 MHz transmitter connected to a digital pin and a 32 768 Hz crystal oscillator
  * connected to T0 (PB2 on ATtiny85).
  *
- * Assumes that an interrupt waking the CPU from sleep will occur 2 048 times per second. It should
- * be straightforward to change how this interrupt is generated (e.g. to use an oscillator with a
- * different frequency) by modifying the configureTimer() and restoreTimer() functions below.
+ * Assumes that an interrupt waking the CPU from sleep will occur 2 048 times per second. A crystal
+ * with a different frequency can be used by defining OS21TX_XO_FREQ; the compare value is worked
+ * out (and checked) at compile time. Other ways of generating the interrupt can be added by
+ * modifying the configureTimer() and restoreTimer() functions below.
+ *
+ * The frame format and line code are picked at compile time with OS21TX_PROTOCOL. The default is
+ * Oregon Scientific v2.1; OS21TX_NEXUS sends the same reading as a Nexus-style PPM frame for base
+ * stations that accept it. With the default repeats, a Nexus transmission is on the air for 468-756
+ * timer periods and keyed for 148 of them, against 768 (plus the gap) and 384 for Oregon.
+ *
+ * The transmitter module can optionally be powered from a separate pin, like DHTWrapper's powerPin.
+ * transmit() switches it on if it isn't already, then waits out whatever part of the settle time
+ * isn't known to have passed, and switches it off right after the last bit is sent. To overlap the
+ * settle time with something else (e.g. the crystal warm-up), call powerOn() beforehand and report
+ * the time spent since with addPoweredTime(); the library can't measure time while the CPU sleeps.
+ *
+ * While transmitting, the CPU clock is divided down to ~1 MHz (see OS21TX_CLOCK_SHIFT). The CPU spends
+ * nearly all of that time idle-sleeping between timer periods, and idle current scales with clock
+ * speed; edge timing comes from the crystal on T0 so it's unaffected. The pause between copies
+ * and the power-on settle time are counted in timer periods rather than with delay(), since
+ * millis() isn't running (and would be scaled) while Timer0 is borrowed.
+ *
+ * If OS21TX_COMPARE_OUTPUT is defined and the pin is OC0A (PB0) or OC0B (PB1), Timer0's compare unit
+ * sets or clears the pin at the exact compare match, so edge placement doesn't depend on how long the
+ * CPU takes to wake up and run the ISR. Any other pin falls back to writing the port after waking.
 
  * More info here: https://shumphries.ca/blog/2023/01/03/oregon-scientific-attiny85
  *
@@ -56,47 +78,225 @@
 //   0x55, // Postamble (CRC checksum)
 // };
 
+#define OS21TX_OREGON_V21 1 // Doubled Manchester, 96 bits, 384 periods (~190 ms) per frame, half of them keyed
+#define OS21TX_NEXUS 2 // PPM, 36 bits repeated NEXUS_ROWS times, 117-189 periods per row, 37 of them keyed
+
+#ifndef OS21TX_PROTOCOL
+#define OS21TX_PROTOCOL OS21TX_OREGON_V21
+#endif
+
+// Nexus-style frame (36 bits, MSB-first, repeated with a long gap between rows)
+// - Rolling ID (8 bits)
+// - Battery OK (1 bit), zero (1 bit), Channel - 1 (2 bits)
+// - Temperature, 10^-1 °C (12 bits, two's complement)
+// - Constant 0xf (4 bits)
+// - Humidity, % (8 bits)
+// Each bit is a one-period pulse followed by a two (0) or four (1) period gap, i.e. ~500 us pulses
+// with ~1 000 us and ~2 000 us gaps at 2 048 Hz; rows are separated by an eight period gap.
+#define NEXUS_BITS 36
+#define NEXUS_ROWS 4 // Receivers typically want at least 3 identical rows; the rows already repeat the frame
+
 #define SUM_MASK 0xfffe0 // Only some nibbles are included in the checksum and CRC calculations
 #define CRC_MASK 0xff3e0
 #define CRC_IV 0x42 // ¯\_(ツ)_/¯ (see the blog post for details)
 #define CRC_POLY 0x7 // CRC-8-CCITT
 
+#if OS21TX_PROTOCOL == OS21TX_NEXUS
+#define DATA_LEN 5
+#else
 #define DATA_LEN 12
-
+#endif
+
+#ifndef OS21TX_XO_FREQ
+#define OS21TX_XO_FREQ 32768 // Hz, oscillator clocking Timer0 via T0
+#endif
+#define OS21TX_PERIOD_FREQ 2048 // Hz, one timer period per half-bit
+#define OS21TX_OCR ((OS21TX_XO_FREQ / OS21TX_PERIOD_FREQ) - 1)
+
+#if OS21TX_XO_FREQ % OS21TX_PERIOD_FREQ != 0 || OS21TX_OCR < 1 || OS21TX_OCR > 0xff
+#error "OS21TX_XO_FREQ must be a multiple of 2 048 Hz between 4 096 Hz and 524 288 Hz"
+#endif
+
+#define OS21TX_MS_TO_PERIODS(ms) (((uint32_t)(ms) * OS21TX_PERIOD_FREQ + 500) / 1000)
+
+#ifndef OS21TX_CLOCK_SHIFT // Extra divide-by-2^n applied on top of the current clock prescaler while transmitting
+#if F_CPU >= 16000000L
+#define OS21TX_CLOCK_SHIFT 4
+#elif F_CPU >= 8000000L
+#define OS21TX_CLOCK_SHIFT 3
+#elif F_CPU >= 4000000L
+#define OS21TX_CLOCK_SHIFT 2
+#elif F_CPU >= 2000000L
+#define OS21TX_CLOCK_SHIFT 1
+#else
+#define OS21TX_CLOCK_SHIFT 0 // Already ~1 MHz or slower (e.g. the factory 8 MHz / 8); leave the clock alone
+#endif
+#endif
+
+#if (F_CPU >> OS21TX_CLOCK_SHIFT) * 2 <= OS21TX_XO_FREQ * 5L
+#error "Timer0 can only count T0 edges slower than f_clk / 2.5; reduce OS21TX_CLOCK_SHIFT"
+#endif
+
+#define OS21TX_EDGE_CYCLES 120 // Worst-case cycles between wake-ups; see the estimate above writeSyncBit()
+
+// sleep_cpu() and a no-op, each with a local label tools/edge_budget.py looks for in the ELF
+#define OS21TX_EDGE_SLEEP() __asm__ __volatile__ ("os21tx_edge_%=: sleep" ::)
+#define OS21TX_WINDOW_END() __asm__ __volatile__ ("os21tx_window_end_%=:" ::)
+
+#if (F_CPU >> OS21TX_CLOCK_SHIFT) / OS21TX_PERIOD_FREQ < 2 * OS21TX_EDGE_CYCLES // Keep 2x margin on an estimate
+#error "Too few CPU cycles per timer period while transmitting; reduce OS21TX_CLOCK_SHIFT"
+#endif
+
+#define OS21TX_NO_POWER_PIN 0xff
+
+#ifndef OS21TX_REPEATS // Copies of the frame sent per transmit(); receivers dedupe them
+#if OS21TX_PROTOCOL == OS21TX_NEXUS
+#define OS21TX_REPEATS 1 // Each copy is already NEXUS_ROWS rows
+#else
+#define OS21TX_REPEATS 2
+#endif
+#endif
+#ifndef OS21TX_REPEAT_GAP
+#define OS21TX_REPEAT_GAP 55 // Pause between copies, in ms
+#endif
+
+#include <avr/power.h>
 #include <avr/sleep.h>
 
 class OS21Tx {
   public:
   const uint8_t pin;
+  const uint8_t powerPin;
+  const uint8_t settleTime; // ms the module needs after power on before it transmits cleanly
 
-  OS21Tx(uint8_t pin): pin(pin) {}
+  OS21Tx(uint8_t pin, uint8_t powerPin = OS21TX_NO_POWER_PIN, uint8_t settleTime = 0): pin(pin), powerPin(powerPin), settleTime(settleTime) {}
 
   void begin(uint8_t channel, uint8_t rollingId) {
     pinMode(pin, OUTPUT);
+    if (powerPin != OS21TX_NO_POWER_PIN) {
+      pinMode(powerPin, OUTPUT);
+      powerOff();
+    }
 
     setRollingId(rollingId);
     setChannel(channel);
   }
 
   void transmit(float temperature, float humidity, bool lowBattery = false) {
-    setTemperature(temperature);
+    powerOn();
+
+    setTemperature(temperature); // The time spent building the frame isn't credited to the settle time
     setHumidity(humidity);
     setLowBattery(lowBattery);
-    setChecksum();
-    setCRC();
+    finishFrame();
+
+    configureTimer();
+
+    if (poweredTime < settleTime) {
+      waitPeriods(OS21TX_MS_TO_PERIODS(settleTime - poweredTime));
+    }
+
+    for (uint8_t i = 0; i < OS21TX_REPEATS; ++i) {
+      if (i > 0) {
+        waitPeriods(OS21TX_MS_TO_PERIODS(OS21TX_REPEAT_GAP)); // Pause for a short time between transmissions
+      }
+      sendFrame();
+      writeSyncBit(LOW); // Don't leave the transmitter on!
+    }
+
+    restoreTimer();
+    powerOff();
+  }
 
-    sendData(); // Send the message twice
-    delay(55); // Pause for a short time between transmissions
-    sendData();
+  void powerOn() {
+    if (powerPin == OS21TX_NO_POWER_PIN || powered) return;
+    digitalWrite(powerPin, HIGH);
+    powered = true;
+    poweredTime = 0;
+  }
+
+  void addPoweredTime(uint16_t ms) {
+    if (!powered) return;
+    poweredTime = (ms > 0xffff - poweredTime) ? 0xffff : poweredTime + ms;
+  }
+
+  void powerOff() {
+    if (powerPin == OS21TX_NO_POWER_PIN) return;
+    digitalWrite(powerPin, LOW); // The data pin is already low after the last frame, so nothing back-powers the module
+    powered = false;
   }
 
   private:
 
+  bool powered = false;
+  uint16_t poweredTime = 0; // ms the module is known to have been on, as reported by addPoweredTime()
+
   uint8_t old_TCCR0A;
   uint8_t old_TCCR0B;
   uint8_t old_OCR0A;
   uint8_t old_TIMSK;
+  clock_div_t old_clockDiv;
+  volatile uint8_t *pinPort; // Output register and bit for the pin, looked up once per transmit()
+  uint8_t pinMask;
+#ifdef OS21TX_COMPARE_OUTPUT
+  uint8_t old_OCR0B;
+
+  bool compareOutput; // Whether the pin is OC0A/OC0B, so the compare unit can drive it
+  uint8_t tccr0aHigh; // TCCR0A values that set/clear the pin on the next compare match
+  uint8_t tccr0aLow;
+#endif
+
+#if OS21TX_PROTOCOL == OS21TX_NEXUS
+  uint8_t data[DATA_LEN] = { // Data frame, initialized with the parts that never change
+    0x00,            // Rolling ID
+    0x00,            // Battery / Channel | Temperature
+    0x00,            // Temperature
+    0xf0,            // Constant | Humidity
+    0x00,            // Humidity
+  };
+
+  void setRollingId(uint8_t rollingId) {
+    data[0] = rollingId;
+  }
+
+  void setChannel(uint8_t channel) {
+    data[1] &= 0xcf; data[1] |= (((channel - 1) << 4) & 0x30); // 1=0x0, 2=0x1, 3=0x2
+  }
+
+  void setTemperature(float t) {
+    const int16_t t_deci = (int16_t)(t * 10 + (t < 0 ? -0.5 : 0.5)); // Rounded to the nearest tenth
+
+    data[1] &= 0xf0; data[1] |= ((t_deci >> 8) & 0x0f);
+    data[2] = t_deci & 0xff;
+  }
+
+  void setHumidity(float h) {
+    const uint8_t h_ones = (uint8_t)(h + 0.5);
+
+    data[3] &= 0xf0; data[3] |= ((h_ones >> 4) & 0x0f);
+    data[4] &= 0x0f; data[4] |= ((h_ones << 4) & 0xf0);
+  }
 
+  void setLowBattery(bool b) {
+    data[1] &= 0x7f; data[1] |= (b ? 0x00 : 0x80); // The bit is set when the battery is OK
+  }
+
+  void finishFrame() {
+    // No checksum; receivers rely on repeated rows instead
+  }
+
+  void sendFrame() {
+    for (int r = 0; r < NEXUS_ROWS; ++r) {
+      uint8_t n = NEXUS_BITS;
+      for (int i = 0; n; ++i) {
+        for (uint8_t mask = 0x80; mask && n; mask >>= 1, --n) { // Bits are transmitted MSB-first
+          sendPPM(data[i] & mask);
+        }
+      }
+      sendPulse(8); // Terminate the last bit and mark the end of the row
+    }
+  }
+#else
   uint8_t data[DATA_LEN] = { // Data frame, initialized with the parts that never change
     0xff,            // Preamble
     0xff,
@@ -157,18 +357,31 @@ class OS21Tx {
     data[11] &= 0x00; data[11] |= (checksumCRC(data, CRC_MASK, CRC_IV) & 0xff);
   }
 
-  void sendData() {
-    configureTimer();
+  void finishFrame() {
+    setChecksum();
+    setCRC();
+  }
 
-    for (int i = 0; i < DATA_LEN * 8; ++i) { // Bits are transmitted LSB-first
-      sendBit((data[i / 8] >> (i % 8)) & 0x1);
+  void sendFrame() {
+    for (int i = 0; i < DATA_LEN; ++i) {
+      uint8_t b = data[i];
+      for (int j = 0; j < 8; ++j) { // Bits are transmitted LSB-first
+        sendDoubledManchester(b & 0x1); // Shift by one each time; a variable shift is a loop on AVR
+        b >>= 1;
+      }
     }
-    writeSyncBit(LOW); // Don't leave the transmitter on!
+  }
+#endif
 
-    restoreTimer();
+  void waitPeriods(uint16_t n) {
+    while (n--) {
+      writeSyncBit(LOW); // Idle-sleeps through each period with the transmitter off
+    }
   }
 
-  void sendBit(bool val) {
+  // Line coders; every level lasts a whole number of 2 048 Hz timer periods
+
+  void sendDoubledManchester(bool val) {
     if (val) {
       sendZero(); // Recall that each bit is sent twice, inverted first
       sendOne();
@@ -178,6 +391,14 @@ class OS21Tx {
     }
   }
 
+  void sendManchester(bool val) {
+    if (val) {
+      sendOne();
+    } else {
+      sendZero();
+    }
+  }
+
   void sendZero() {
     writeSyncBit(LOW);
     writeSyncBit(HIGH);
@@ -188,10 +409,29 @@ class OS21Tx {
     writeSyncBit(LOW);
   }
 
-  static uint8_t checksumSimple(const uint8_t data[], uint64_t mask) {
+  void sendPWM(bool val) {
+    // Pulse width coding in a fixed three period bit: short (1 period) pulse for 1, long (2 periods) for 0,
+    // as LaCrosse-style receivers expect
+    writeSyncBit(HIGH);
+    writeSyncBit(val ? LOW : HIGH);
+    writeSyncBit(LOW);
+  }
+
+  void sendPPM(bool val) {
+    sendPulse(val ? 4 : 2); // Pulse distance coding: the gap after each pulse carries the bit
+  }
+
+  void sendPulse(uint8_t gapPeriods) {
+    writeSyncBit(HIGH);
+    for (uint8_t i = 0; i < gapPeriods; ++i) {
+      writeSyncBit(LOW);
+    }
+  }
+
+  static uint8_t checksumSimple(const uint8_t data[], uint32_t mask) { // 64-bit shifts are library calls on AVR
     uint16_t s = 0x0000;
 
-    for (int i = 0; i < 64; ++i) {
+    for (int i = 0; i < 32; ++i) {
       if (!((mask >> i) & 0x1)) continue; // Skip nibbles that aren't set in the mask
 
       s += (data[i / 2] >> ((i % 2) * 4)) & 0xf; // Sum data nibble by nibble
@@ -203,10 +443,10 @@ class OS21Tx {
   }
 
 
-  static uint8_t checksumCRC(const uint8_t data[], uint64_t mask, uint8_t iv) {
+  static uint8_t checksumCRC(const uint8_t data[], uint32_t mask, uint8_t iv) {
     uint16_t s = iv;
 
-    for (int i = 0; i < 64; ++i) {
+    for (int i = 0; i < 32; ++i) {
       if (!((mask >> i) & 0x1)) continue; // Skip nibbles that aren't set in the mask
 
       uint8_t nibble = (data[i / 2] >> ((i % 2) * 4)) & 0xf;
@@ -233,11 +473,34 @@ class OS21Tx {
     return s;
   }
 
+  // Budget: one timer period (488 us, i.e. ~488 cycles at the ~1 MHz transmit clock) from each wake-up
+  // to the next sleep instruction. Hand-counted worst case (the last edge of a byte); run
+  // tools/edge_budget.py on the exported ELF to check the compiled code:
+  // - Wake from idle and interrupt response: 8, vector jump: 2, empty ISR prologue/epilogue + reti: 19
+  // - Port write (or TCCR0A arm) including loading pinPort/pinMask through this: ~13
+  // - Returns out of writeSyncBit/sendOne/sendDoubledManchester: 12
+  // - Inner and outer frame loop bookkeeping and loading the next data byte: ~18
+  // - Calls and prologues into sendDoubledManchester/sendZero/writeSyncBit, val tests: ~15, sleep: 1
+  // That's ~90 cycles, rounded up to OS21TX_EDGE_CYCLES; the PPM loop is similar
   void writeSyncBit(bool val) {
+#ifdef OS21TX_COMPARE_OUTPUT
+    if (compareOutput) {
+      // Arm the compare unit to drive the pin on the next match, then sleep through that match
+      // The edge itself is placed by hardware; software only has to arm the next one within 488 us
+      TCCR0A = val ? tccr0aHigh : tccr0aLow;
+      OS21TX_EDGE_SLEEP();
+      return;
+    }
+#endif
+
     // Synchronise writes to the 2048 Hz timer by sleeping until the timer interrupt
     // This works so long as there's less than 488 us worth of computation between write calls
-    sleep_cpu(); // Sleep right before a pin change (rather than after) to ensure all edges are identically spaced
-    digitalWrite(pin, val);
+    OS21TX_EDGE_SLEEP(); // Sleep right before a pin change (rather than after) to ensure all edges are identically spaced
+    if (val) { // Write the port directly; digitalWrite() does table lookups between the wake-up and the edge
+      *pinPort |= pinMask;
+    } else {
+      *pinPort &= ~pinMask;
+    }
   }
 
   void configureTimer() {
@@ -245,12 +508,38 @@ class OS21Tx {
     old_TCCR0B = TCCR0B;
     old_OCR0A = OCR0A;
     old_TIMSK = TIMSK;
+    pinPort = portOutputRegister(digitalPinToPort(pin));
+    pinMask = digitalPinToBitMask(pin);
+#ifdef OS21TX_COMPARE_OUTPUT
+    old_OCR0B = OCR0B;
+
+    // Only OC0A (PB0) and OC0B (PB1) are wired to the compare unit; other pins use the port path
+    compareOutput = (pinPort == &PORTB) && (pinMask == (1 << PB0) || pinMask == (1 << PB1));
+    const uint8_t comShift = (pinMask == (1 << PB0)) ? COM0A0 : COM0B0;
+    tccr0aHigh = (1 << WGM01) | (0x3 << comShift); // COM0x1:0 = 11, set on compare match
+    tccr0aLow = (1 << WGM01) | (0x2 << comShift); // COM0x1:0 = 10, clear on compare match
+
+    digitalWrite(pin, LOW); // The port drives the pin again once the compare unit is disconnected
+#endif
 
     cli();
     TCCR0A = (1 << WGM01); // CTC (Clear Timer on Compare Match)
     TCCR0B = (1 << CS02) | (1 << CS01) | (1 << CS00); // External clock source on T0 pin
-    OCR0A = 0xf; // Output compare register (32 768 Hz / 16 = 2 048 Hz)
+    OCR0A = OS21TX_OCR; // Output compare register (e.g. 32 768 Hz / 16 = 2 048 Hz)
     TIMSK = (1 << OCIE0A); // Interrupt on output compare match
+#ifdef OS21TX_COMPARE_OUTPUT
+    if (compareOutput) {
+      OCR0B = OS21TX_OCR; // Match OC0B at the same count as OC0A
+      TCCR0A = tccr0aLow;
+      TCCR0B |= (1 << FOC0A) | (1 << FOC0B); // Force a match so the output starts low
+    }
+#endif
+
+#if OS21TX_CLOCK_SHIFT > 0
+    old_clockDiv = clock_prescale_get(); // F_CPU is the clock with this prescaler applied, so divide relative to it
+    const uint8_t clockDiv = old_clockDiv + OS21TX_CLOCK_SHIFT;
+    clock_prescale_set((clock_div_t)(clockDiv > (uint8_t)clock_div_256 ? (uint8_t)clock_div_256 : clockDiv)); // Does the timed CLKPCE sequence in asm
+#endif
     sei();
 
     set_sleep_mode(SLEEP_MODE_IDLE);
@@ -258,6 +547,7 @@ class OS21Tx {
   }
 
   void restoreTimer() {
+    OS21TX_WINDOW_END(); // No edges after this, so tools/edge_budget.py stops timing here
     sleep_disable();
 
     cli();
@@ -265,6 +555,12 @@ class OS21Tx {
     TCCR0B = old_TCCR0B;
     OCR0A = old_OCR0A;
     TIMSK = old_TIMSK;
+#ifdef OS21TX_COMPARE_OUTPUT
+    OCR0B = old_OCR0B;
+#endif
+#if OS21TX_CLOCK_SHIFT > 0
+    clock_prescale_set(old_clockDiv); // Back to full speed before anything relies on F_CPU again
+#endif
     sei();
   }
 };
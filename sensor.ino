@@ -43,12 +43,21 @@ DHTWrapper dht = DHTWrapper(DHT_DATA_PIN, DHT_POWER_PIN);
 
 #define T0_PIN 2
 #define T0_XO_POWER_PIN 1 // Power for the crystal oscillator clocking Timer0
-#include "OS21Tx.h"
 #define TX_PIN 0 // Output for the 433.92 Mhz modulator
+#define OS21TX_COMPARE_OUTPUT // TX_PIN is OC0A, so let Timer0 drive it in hardware
+#include "OS21Tx.h"
 OS21Tx tx = OS21Tx(TX_PIN);
 
 #include <EEPROM.h>
-#define RESET_COUNT_ADDR 0 // Where to store the current reset count (used for seeding RNG and saving channel setting)
+#include "EEPROMJournal.h"
+#define RESET_COUNT_ADDR 0 // Where older firmware stored the reset count (read once to migrate it into the journal)
+
+struct PersistentState { // Only ever append fields; older records are loaded as a prefix of this
+  uint32_t resetCount; // Used for seeding RNG and saving channel setting
+};
+EEPROMJournal<PersistentState> journal = EEPROMJournal<PersistentState>( // Spread across the rest of the EEPROM
+  RESET_COUNT_ADDR + sizeof(uint32_t), E2END + 1 - (RESET_COUNT_ADDR + sizeof(uint32_t)) // Clear of the old count so it's never mistaken for a record
+);
 
 #define RESET_PIN 5
 
@@ -67,15 +76,24 @@ void setup() {
 
   pinMode(T0_XO_POWER_PIN, OUTPUT);
 
-  uint32_t resetCount;
-  EEPROM.get(RESET_COUNT_ADDR, resetCount);
+  PersistentState state = {}; // Zeroed, so fields the newest record doesn't cover start out as 0
+  switch (journal.begin(state)) {
+    case JOURNAL_BLANK: // Nothing journalled yet, so migrate the count stored by older firmware
+      EEPROM.get(RESET_COUNT_ADDR, state.resetCount);
+      break;
+    case JOURNAL_INVALID: // The journal has been written but nothing validates; start over rather than trust address 0
+      break;
+    case JOURNAL_RESIZED: // Written by firmware with a different PersistentState; store it in the current layout
+      journal.put(state);
+      break;
+  }
   if (_MCUSR & (1 << EXTRF)) { // Increment the saved channel if an external reset was triggered
-    ++resetCount;
-    EEPROM.put(RESET_COUNT_ADDR, resetCount);
+    ++state.resetCount;
+    journal.put(state);
   }
 
-  uint8_t channel = (resetCount % 3) + 1; // i.e. 1, 2, or 3
-  randomSeed(resetCount); // Seed RNG for picking Rolling ID
+  uint8_t channel = (state.resetCount % 3) + 1; // i.e. 1, 2, or 3
+  randomSeed(state.resetCount); // Seed RNG for picking Rolling ID
 
   dht.begin();
   tx.begin(channel, random(256));
@@ -135,7 +153,15 @@ long getVcc() {
   ADCSRA = (1 << ADEN); // Enable ADC
   ADMUX = (1 << MUX3) | (1 << MUX2); // Vcc as voltage reference; 1.1V bandgap voltage as measurement target
 
-  delay(2); // Allow ADC to settle after switching to internal voltage reference (as per datasheet)
+  // Allow ADC to settle after switching to internal voltage reference (as per datasheet)
+#if OS21TX_CLOCK_SHIFT > 0
+  const clock_div_t clockDiv = clock_prescale_get(); // Nothing to do but wait, so wait at ~1 MHz like OS21Tx does
+  clock_prescale_set((clock_div_t)(clockDiv + OS21TX_CLOCK_SHIFT)); // Can't pass clock_div_256: the shift is picked from F_CPU
+  delayMicroseconds(2000 >> OS21TX_CLOCK_SHIFT); // Counts CPU cycles, so it runs 2^OS21TX_CLOCK_SHIFT times slower
+  clock_prescale_set(clockDiv);
+#else
+  delay(2);
+#endif
 
   ADCSRA |= (1 << ADSC); // Start conversion
   while (ADCSRA & (1 << ADSC));
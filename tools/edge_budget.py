@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+"""
+Checks that the compiled transmit loop gets from every timer wake-up to the next sleep within one
+timer period, using the disassembly of the sketch's ELF.
+
+Export the ELF from the Arduino IDE (Sketch > Export compiled binary) and run, e.g.:
+
+    tools/edge_budget.py build/ATTinyCore.avr.attinyx5/sensor.ino.elf --f-cpu 8000000
+
+The sleeps that place edges are tagged os21tx_edge_* and the end of the transmit window is tagged
+os21tx_window_end_* (see OS21TX_EDGE_SLEEP() and OS21TX_WINDOW_END() in OS21Tx.h). From each
+tagged sleep, every path through the code, following calls and returns, is walked to the next
+tagged sleep. Its cycles are counted with the AVRe instruction timings, taking the slower side
+of every branch and skip. The cost of waking up and running TIMER0_COMPA_vect (found the same
+way) is added to each path. The script exits with 1 if the worst path leaves less than
+--min-slack cycles of the period, or with 2 if the code can't be bounded, e.g. a loop with no
+tagged sleep in it, an indirect jump, or an untagged sleep.
+
+More info here: https://shumphries.ca/blog/2023/01/03/oregon-scientific-attiny85
+
+LICENCE
+
+Copyright © 2023 Stephen Humphries
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+PERIOD_FREQ = 2048 # Hz, OS21TX_PERIOD_FREQ
+EDGE_LABEL = "os21tx_edge_"
+END_LABEL = "os21tx_window_end_"
+
+# Fixed cost in front of the ISR on every wake-up (ATtiny85 datasheet, section 4.7.1)
+WAKE_CYCLES = 4 # MCU halted after an interrupt wakes it from idle
+RESPONSE_CYCLES = 4 # Interrupt response: push PC, jump to vector
+VECTOR_CYCLES = 2 # rjmp in the vector table
+
+MAX_CALL_DEPTH = 32
+
+# AVRe timings (AVR Instruction Set Manual); everything not listed takes 1 cycle
+CYCLES = {}
+CYCLES.update(dict.fromkeys(["adiw", "sbiw", "ld", "ldd", "st", "std", "lds", "sts", "push", "pop",
+                             "cbi", "sbi", "rjmp", "ijmp", "mul", "muls", "mulsu", "fmul", "fmuls",
+                             "fmulsu"], 2))
+CYCLES.update(dict.fromkeys(["lpm", "rcall", "icall", "jmp"], 3))
+CYCLES.update(dict.fromkeys(["call", "ret", "reti"], 4))
+
+BRANCHES = {"brbs", "brbc", "breq", "brne", "brcs", "brcc", "brsh", "brlo", "brmi", "brpl", "brge",
+            "brlt", "brhs", "brhc", "brts", "brtc", "brvs", "brvc", "brie", "brid"}
+SKIPS = {"cpse", "sbrc", "sbrs", "sbic", "sbis"}
+INDIRECT = {"ijmp", "icall", "eijmp", "eicall"}
+
+SYMBOL_RE = re.compile(r"^([0-9a-f]+) (.{7}) (\S+)\t([0-9a-f]+) (.+)$")
+INSN_RE = re.compile(r"^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t(\S+)\s*([^;]*?)\s*(?:;\s*(?:0x([0-9a-f]+))?.*)?$")
+RELATIVE_RE = re.compile(r"^\.([+-]\d+)$")
+
+
+class AnalysisError(Exception):
+  pass
+
+
+class Insn:
+  def __init__(self, addr, size, mnem, ops, target):
+    self.addr = addr
+    self.size = size
+    self.mnem = mnem
+    self.ops = ops
+    self.target = target
+    self.labels = []
+
+
+class Program:
+  def __init__(self, text):
+    self.insns = {}
+    self.functions = [] # (start, end, name) from the symbol table
+    self.symbols = {} # addr -> [name]
+    self.sites = {} # function entry -> return_sites()
+
+    for line in text.splitlines():
+      m = SYMBOL_RE.match(line)
+      if m and m.group(3) == ".text":
+        addr, size, name = int(m.group(1), 16), int(m.group(4), 16), m.group(5).split()[-1]
+        self.symbols.setdefault(addr, []).append(name)
+        if "F" in m.group(2):
+          self.functions.append((addr, addr + size, name))
+        continue
+
+      m = INSN_RE.match(line)
+      if m:
+        addr = int(m.group(1), 16)
+        size = len(m.group(2).split())
+        mnem, ops = m.group(3), m.group(4)
+        target = None
+        rel = RELATIVE_RE.match(ops)
+        if m.group(5):
+          target = int(m.group(5), 16)
+        elif rel:
+          target = addr + 2 + int(rel.group(1))
+        self.insns[addr] = Insn(addr, size, mnem, ops, target)
+
+    for addr, names in self.symbols.items():
+      if addr in self.insns:
+        self.insns[addr].labels = names
+
+    self.functions.sort()
+
+  def function_of(self, addr):
+    for start, end, name in self.functions:
+      if start <= addr < end:
+        return start, name
+    raise AnalysisError("0x%x isn't inside any function in the symbol table" % addr)
+
+  def describe(self, addr):
+    try:
+      start, name = self.function_of(addr)
+      return "%s+0x%x" % (name, addr - start)
+    except AnalysisError:
+      return "0x%x" % addr
+
+  def insn(self, addr):
+    if addr not in self.insns:
+      raise AnalysisError("control reaches 0x%x, which isn't a disassembled instruction" % addr)
+    return self.insns[addr]
+
+  def tagged(self, prefix):
+    return sorted(a for a, i in self.insns.items() if any(l.startswith(prefix) for l in i.labels))
+
+  def find_symbol(self, name):
+    for addr, names in self.symbols.items():
+      if name in names:
+        return addr
+    raise AnalysisError("no symbol named %s" % name)
+
+  def return_sites(self, entry, seen=None):
+    # Where a return out of the function at entry can land: after each call to it, or wherever a
+    # function that tail-jumps into it returns to
+    top = seen is None
+    if top and entry in self.sites:
+      return self.sites[entry]
+    seen = seen or set()
+    if entry in seen:
+      return set()
+    seen.add(entry)
+
+    sites = set()
+    for insn in self.insns.values():
+      if insn.target != entry:
+        continue
+      if insn.mnem in ("rcall", "call"):
+        sites.add(insn.addr + insn.size)
+      elif insn.mnem in ("rjmp", "jmp") and self.function_of(insn.addr)[0] != entry:
+        sites |= self.return_sites(self.function_of(insn.addr)[0], seen)
+    if top:
+      self.sites[entry] = sites
+    return sites
+
+
+class LongestPath:
+  """Longest path (in cycles) from an instruction to a terminal, following calls and returns"""
+
+  def __init__(self, program, terminal):
+    self.program = program
+    self.terminal = terminal # insn -> cycles if the path ends there (None = unconstrained), or False
+    self.memo = {}
+    self.active = set()
+
+  def successors(self, insn, stack):
+    p = self.program
+    m = insn.mnem
+    nxt = insn.addr + insn.size
+
+    if m in INDIRECT:
+      raise AnalysisError("indirect %s at %s can't be followed" % (m, p.describe(insn.addr)))
+    if m in ("rcall", "call"):
+      if len(stack) >= MAX_CALL_DEPTH:
+        raise AnalysisError("calls nest deeper than %d at %s" % (MAX_CALL_DEPTH, p.describe(insn.addr)))
+      return [(CYCLES[m], insn.target, stack + (nxt,))]
+    if m == "ret":
+      if stack:
+        return [(CYCLES[m], stack[-1], stack[:-1])]
+      entry, name = p.function_of(insn.addr)
+      sites = p.return_sites(entry)
+      if not sites:
+        raise AnalysisError("%s returns, but nothing calls it" % name)
+      return [(CYCLES[m], site, ()) for site in sorted(sites)]
+    if m == "reti":
+      raise AnalysisError("reti outside the ISR at %s" % p.describe(insn.addr))
+    if m in ("rjmp", "jmp"):
+      return [(CYCLES[m], insn.target, stack)]
+    if m in BRANCHES:
+      return [(1, nxt, stack), (2, insn.target, stack)]
+    if m in SKIPS:
+      return [(1, nxt, stack), (2 if p.insn(nxt).size == 2 else 3, nxt + p.insn(nxt).size, stack)]
+    if m == "sleep":
+      raise AnalysisError("untagged sleep at %s" % p.describe(insn.addr))
+    if m.startswith("."):
+      raise AnalysisError("control reaches data (%s) at %s" % (m, p.describe(insn.addr)))
+    return [(CYCLES.get(m, 1), nxt, stack)]
+
+  def walk(self, addr, stack=()):
+    # Returns (cycles, [addrs]) for the slowest path that reaches a constrained terminal, or None
+    key = (addr, stack)
+    if key in self.memo:
+      return self.memo[key]
+    if key in self.active:
+      raise AnalysisError("loop through %s without a tagged sleep" % self.program.describe(addr))
+
+    insn = self.program.insn(addr)
+    end = self.terminal(insn)
+    if end is not False:
+      result = None if end is None else (end, [addr])
+      self.memo[key] = result
+      return result
+
+    self.active.add(key)
+    best = None
+    for cycles, target, new_stack in self.successors(insn, stack):
+      rest = self.walk(target, new_stack)
+      if rest is not None and (best is None or cycles + rest[0] > best[0]):
+        best = (cycles + rest[0], [addr] + rest[1])
+    self.active.discard(key)
+
+    self.memo[key] = best
+    return best
+
+
+def analyse(program, vector):
+  edges = program.tagged(EDGE_LABEL)
+  if not edges:
+    raise AnalysisError("no %s* labels; was the ELF built from this version of OS21Tx.h?" % EDGE_LABEL)
+  ends = set(program.tagged(END_LABEL))
+  if not ends:
+    raise AnalysisError("no %s* label; was the ELF built from this version of OS21Tx.h?" % END_LABEL)
+  for addr in edges:
+    if program.insn(addr).mnem != "sleep":
+      raise AnalysisError("%s isn't a sleep instruction" % program.describe(addr))
+
+  def isr_terminal(insn):
+    return CYCLES["reti"] if insn.mnem == "reti" else False
+
+  isr = LongestPath(program, isr_terminal).walk(program.find_symbol(vector))
+  if isr is None:
+    raise AnalysisError("%s never returns" % vector)
+  wake = WAKE_CYCLES + RESPONSE_CYCLES + VECTOR_CYCLES + isr[0]
+
+  def edge_terminal(insn):
+    if insn.addr in ends:
+      return None # Timing stops mattering at the end of the window
+    if insn.mnem == "sleep" and insn.addr in edges:
+      return 1
+    return False
+
+  walker = LongestPath(program, edge_terminal)
+  paths = {}
+  for addr in edges:
+    path = walker.walk(addr + program.insn(addr).size)
+    if path is not None:
+      paths[addr] = (wake + path[0], path[1])
+  return wake, paths
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+  parser.add_argument("elf", help="ELF exported from the Arduino IDE, or the output of objdump -t -d with --disassembly")
+  parser.add_argument("--disassembly", action="store_true", help="the input is already the output of avr-objdump -t -d")
+  parser.add_argument("--objdump", default="avr-objdump", help="objdump to run (default: %(default)s)")
+  parser.add_argument("--f-cpu", type=int, default=8000000, help="F_CPU the sketch was built with (default: %(default)s)")
+  parser.add_argument("--clock-shift", type=int, help="OS21TX_CLOCK_SHIFT, if overridden (default: picked from F_CPU like OS21Tx.h)")
+  parser.add_argument("--min-slack", type=int, help="fail below this many spare cycles per period (default: half the period)")
+  parser.add_argument("--vector", default="__vector_10", help="TIMER0_COMPA_vect's symbol (default: %(default)s, ATtiny25/45/85)")
+  parser.add_argument("-v", "--verbose", action="store_true", help="list every instruction on the slowest path")
+  args = parser.parse_args()
+
+  shift = args.clock_shift
+  if shift is None:
+    shift = next((s for s, f in ((4, 16000000), (3, 8000000), (2, 4000000), (1, 2000000)) if args.f_cpu >= f), 0)
+  period = (args.f_cpu >> shift) // PERIOD_FREQ
+  min_slack = period // 2 if args.min_slack is None else args.min_slack # Same 2x margin as OS21TX_EDGE_CYCLES
+
+  try:
+    if args.disassembly:
+      with open(args.elf) as f:
+        text = f.read()
+    else:
+      text = subprocess.run([args.objdump, "-t", "-d", args.elf], check=True, stdout=subprocess.PIPE,
+                            universal_newlines=True).stdout
+    program = Program(text)
+    wake, paths = analyse(program, args.vector)
+  except (AnalysisError, OSError, subprocess.CalledProcessError) as e:
+    print("edge_budget: %s" % e, file=sys.stderr)
+    return 2
+
+  print("%d cycles per timer period at %d Hz / 2^%d; wake-up and %s: %d cycles" %
+        (period, args.f_cpu, shift, args.vector, wake))
+  for addr, (cycles, _) in sorted(paths.items(), key=lambda p: -p[1][0]):
+    print("  %-40s %4d cycles to the next edge" % (program.describe(addr), cycles))
+  if not paths:
+    print("edge_budget: no tagged sleep reaches another one", file=sys.stderr)
+    return 2
+
+  worst_addr, (worst, path) = max(paths.items(), key=lambda p: p[1][0])
+  slack = period - worst
+  if args.verbose:
+    print("slowest path, after waking at %s:" % program.describe(worst_addr))
+    for addr in path:
+      insn = program.insn(addr)
+      print(("  %-40s %s %s" % (program.describe(addr), insn.mnem, insn.ops)).rstrip())
+
+  print("worst case %d cycles, slack %d (minimum %d)" % (worst, slack, min_slack))
+  return 0 if slack >= min_slack else 1
+
+
+if __name__ == "__main__":
+  sys.setrecursionlimit(100000) # walk() recurses once per instruction on a path
+  sys.exit(main())